@@ -13,11 +13,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <time.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+
+// SIMD intrinsics for the newline indexer, the kernels are picked at runtime
+// so the binary still runs on CPUs without AVX2
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXIT_HAVE_X86 1
+#endif
 
 // Disabled flags: ECHO, ICANON, ISIG, IXON, IEXTEN, ICRNL, OPOST.
 // These correspond to specific CTRL operations.
@@ -36,6 +48,24 @@
 #define TEXIT_TAB_STOP 4
 #define KILO_QUIT_TIMES 3
 
+#define TEXIT_MAX_THREADS 16
+#define TEXIT_INDEX_CHUNK_MIN (1 << 20) // don't give a thread less than 1MB of file to index
+#define TEXIT_BUILD_ROWS_MIN 65536 // don't give a thread less than 64k rows to build
+#define TEXIT_SLAB_SIZE (1 << 20) // the arena hands out memory from blocks of 1MB
+#define TEXIT_SHORT_LINE 256 // loaded lines shorter than this keep their chars in the arena
+#define TEXIT_WORD_MAX 64 // longer words are not put in the word index
+#define TEXIT_INDEX_BATCH 4096 // rows indexed between two checks for pending input
+#define TEXIT_WORD_BLOCK 256 // words per block of the sorted word list
+#define TEXIT_LABEL_GAP 256 // rows that had to be relabeled get at least this much room between them
+#define TEXIT_LINES_MIN 16384 // don't give a thread less than 16k rows to sort or scan
+#define TEXIT_HEX_WIDTH 16 // bytes per row in the hex view
+#define TEXIT_BINARY_SNIFF 8192 // how much of a file is looked at to decide it's binary
+#define TEXIT_COLD_BLOCK (1 << 16) // cold rows are packed into blocks of about 64KB
+#define TEXIT_COLD_DISTANCE 1000 // rows this close to the top of the screen are never packed
+#define TEXIT_COLD_SCAN 65536 // rows looked at between two checks for pending input
+#define LZ_HASH_BITS 14 // the compressor remembers 2^14 recent 4 byte sequences
+#define LZ_MIN_MATCH 4
+
 // hex 0x1f = 0001 1111 (in binary) = 31 (in decimal)
 #define CTRL_KEY(k) ((k) & 0x1f) // Simple macro for better understanding
 
@@ -58,13 +88,111 @@ enum editorKey { // important functional keys
 
 
 typedef struct erow{
+    char* chars; // file row chars content, NULL while the row is packed
+    union {
+        char* render; // the row character content that will actually be displayed on the screen
+                      // basically what will be drawn on the screen, not the direct file contents
+                      // If there is nothing to expand (no tabs), render points to chars itself
+        struct coldBlock *cold; // while packed: the compressed block holding the row's chars
+    };
     int size; // file row char size
-    int rsize; // screen row char size
-    char* chars; // file row chars content
-    char* render; // the row character content that will actually be displayed on the screen
-                  // basically what will be drawn on the screen, not the direct file contents
+    int rsize; // screen row char size. While packed: where the chars start in the unpacked block
+    // The flags share their word with the file offset, so they don't make the struct any bigger.
+    // 60 bits of offset still cover files of up to 2^59 bytes
+    long long off : 60; // where the row started in the file when it was last loaded/saved, -1 for new rows
+    unsigned long long pooled : 1; // chars live in the E.pool arena instead of their own malloc
+    unsigned long long changed : 1; // the row's bytes on disk differ from chars + '\n'
+    unsigned long long packed : 1; // the row is compressed into a cold block, see editorRowTouch()
+    unsigned long long ref : 1; // the row was used since the packer last came by
 }erow;
 
+// A run of rows compressed together. It is freed once none of its rows are packed anymore
+typedef struct coldBlock {
+    size_t rawlen; // size of the rows' chars, one after the other
+    size_t complen; // size of data, equal to rawlen if compressing didn't help
+    int live; // rows still packed in here
+    unsigned char data[];
+} coldBlock;
+
+// Memory budget. When the rows take more than budget bytes, rows that are far
+// from the screen and weren't used lately are packed into compressed blocks
+typedef struct coldStore {
+    size_t budget; // 0 --> no budget, nothing is ever packed
+    size_t resident; // bytes taken by the chars and renders of the unpacked rows
+    size_t rawbytes, compbytes; // totals over all the live blocks, for the compression ratio
+    unsigned long hits, misses; // block reads that found the block in cache / had to decompress it
+    unsigned long unpacked; // packed rows that had to be brought back
+    coldBlock *cached; // block currently unpacked in cache
+    unsigned char *cache;
+    size_t cachecap;
+    int hand; // the packer goes around E.row like a clock hand, this is where it is
+    int idle; // rows looked at since the packer last packed something
+    int rowoff; // E.rowoff when the packer last started over, see editorIdle()
+    size_t seenbudget; // budget when the packer last started over
+} coldStore;
+
+// One block of the slab arena. Allocations are just cut off the front of data
+typedef struct slab {
+    size_t used, cap; // bytes of data handed out / total
+    int live; // allocations from this slab that haven't been released yet
+    char data[];
+} slab;
+
+// Arena that packs many small allocations into big slabs, so they don't each pay
+// for their own malloc header. Once everything in a slab is released the slab is freed
+typedef struct slabArena {
+    slab **slabs; // sorted by address, so a pointer can be traced back to its slab
+    int count, cap;
+    slab *cur; // the slab new allocations come from
+} slabArena;
+#define SLAB_ARENA_INIT {NULL, 0, 0, NULL}
+
+// A word of the word index, and the rows it appears on
+typedef struct wordEntry {
+    const char *word; // NULL for an empty slot of the hash table
+    int len;
+    unsigned int *labels; // labels of the rows containing the word, in row order, every row at most once
+    int nrows, cap;
+    unsigned int pass; // see wordIndexRelabel()
+    int cursor;
+} wordEntry;
+
+// A run of the sorted word list
+typedef struct wordBlock {
+    int n;
+    const char *word[TEXIT_WORD_BLOCK];
+    unsigned char len[TEXIT_WORD_BLOCK];
+} wordBlock;
+
+// Inverted index over the words in E.row: word --> rows that contain it.
+// It is built a batch at a time while the editor waits for keys,
+// and row edits keep the already indexed part up to date.
+// Postings hold row labels instead of row indexes. Labels grow along the rows but leave gaps,
+// so rows can come and go above a row without touching its postings, and a label is turned
+// back into a row index with a binary search over label[]
+typedef struct wordIndex {
+    wordEntry *table; // open addressing hash table, the size is a power of 2
+    int size, count;
+    slabArena strings; // the words themselves
+    wordBlock **blocks; // every word of the table in sorted order, cut into blocks, for completion
+    int nblocks, blockcap;
+    int built; // rows [0, built) are in the index
+    unsigned int *label; // label of every row in [0, built), increasing
+    int labelcap;
+    unsigned int pass; // relabelings so far
+} wordIndex;
+
+// State of the hex view, used instead of E.row for binary files.
+// The file stays mapped, and only the rows on screen are ever formatted
+typedef struct hexView {
+    int active;
+    unsigned char *map; // the file, mapped read-only. Edited pages are made writable (and so copied) one by one
+    size_t size;
+    int offwidth; // hex digits of the offset column: enough for the last offset, at least 8
+    size_t dirtylo, dirtyhi; // bytes [dirtylo, dirtyhi) were overwritten since the last save
+    int nibble; // 0: the cursor is on the high hex digit of the byte, 1: on the low one
+} hexView;
+
 // Convenient struct to store everything related to our terminal settings
 // IMPORTANT!: cx and cy use 0-based indexing, even though terminals are 1-based indexed
 struct editorConfig {
@@ -77,12 +205,22 @@ struct editorConfig {
     int screencols;
 
     int numrows; // number of the rows in the file that we open
+    int rowcap; // how many rows E.row has room for, grows in big steps and not one by one
     // an array that will contain all the rows of the opened file
     erow *row;
+    slabArena pool; // where the chars of short loaded rows are kept
+    wordIndex words; // which rows each word appears on
+    hexView hex; // binary files are shown here instead of in E.row
+    coldStore cold; // compression of rows that don't fit into the memory budget
     struct termios orig_termios;
     int dirty; // indicates whether the text loaded in our editor differs from what's in file
 
     char *filename; // the name of our file that we open
+    // The file as it was after the last load/save, to tell whether someone else changed it since
+    off_t filesize; // -1 if we don't know it
+    struct timespec filemtime;
+    dev_t filedev;
+    ino_t fileino;
     char statusmsg[80];
     time_t statusmsg_time;
 };
@@ -97,6 +235,58 @@ struct abuf {
 // constructor for our abuf struct
 #define ABUF_INIT {NULL, 0} // pointer to null, length = 0
 
+// One entry of the line-offset table, there is one per line of the file
+// eol: offset of the '\n' that ends the line, the next line starts right after it
+// end: offset where the line's text ends, trailing '\r's are already stripped
+typedef struct lineIndex {
+    size_t eol;
+    size_t end;
+} lineIndex;
+
+// The file buffer is cut into chunks and every chunk is indexed by its own thread
+typedef struct indexChunk {
+    const char *buf;
+    size_t from, to; // byte range [from, to) of the buffer this chunk scans
+    lineIndex *lines; // the lines ending inside this chunk, in file order
+    size_t count, cap;
+    void (*scan)(struct indexChunk *); // picked once by editorIndexLines for all chunks
+} indexChunk;
+
+// One thread's share of a parallel merge sort over row pointers.
+// First a thread sorts rows[lo, hi), later a thread merges rows[lo, mid) with rows[mid, hi)
+typedef struct sortJob {
+    erow **rows;
+    erow **tmp; // scratch space as big as rows
+    size_t lo, mid, hi;
+} sortJob;
+
+// One thread's share of a line filter: keep[i] is set for the rows that stay
+typedef struct filterJob {
+    int from, to; // rows [from, to) of E.row
+    int first; // first row of the whole range, uniq doesn't compare it with the row above
+    int mode; // one of the FILTER_ values
+    const char *pattern;
+    size_t patlen;
+    unsigned char *keep; // indexed from the first row of the whole range
+} filterJob;
+
+enum filterMode {
+    FILTER_UNIQ, // drop rows that are the same as the row right above
+    FILTER_KEEP, // keep only rows containing the pattern
+    FILTER_DROP  // drop rows containing the pattern
+};
+
+// A range of the line-offset table that one thread turns into rows
+typedef struct rowBuildJob {
+    const char *buf;
+    size_t len; // length of buf
+    const lineIndex *lines;
+    size_t from, to; // lines [from, to) of the table
+    erow *rows; // where the row built from line i goes: rows[i]
+    slabArena pool; // every thread has its own arena, merged into E.pool when it's done
+    size_t resident; // memory taken by the rows this thread built
+} rowBuildJob;
+
 
 /*** Prototypes ***/
 void die(const char *s);
@@ -111,9 +301,25 @@ int getWindowSize(int *rows, int *cols);
 void editorMoveCursor(int key);
 void editorOpen(char* filename);
 void editorAppendRow(char *s, size_t len);
+void editorInsertRow(int at, char *s, size_t len);
+void editorSpliceRows(int at, int ndel, char **lines, size_t *lens, int nins);
+void editorReserveRows(int n);
+void editorInitRow(erow *row, const char *s, size_t len, slabArena *pool);
 void editorScroll();
 void editorUpdateRow(erow *row);
 void editorSetStatusMessage(const char *fmt, ...);
+void editorLoadBuffer(const char *buf, size_t len);
+void wordIndexAddRow(int at);
+void wordIndexRemoveRow(int at);
+void wordIndexSplice(int at, int ndel, int nins);
+void wordIndexReset();
+char *editorPrompt(char *prompt);
+int editorIsBinary(const char *buf, size_t len);
+void editorHexSave();
+void editorRowTouch(erow *row);
+const char *editorRowChars(erow *row);
+void editorRowUnpack(erow *row);
+void editorColdRelease(coldBlock *blk);
 
 
 // error handling function
@@ -253,11 +459,99 @@ int getWindowSize(int *rows, int *cols) {
     }
 }
 
+/*** Slab arena ***/
+
+int slabCompare(const void *a, const void *b){
+    const slab *x = *(slab * const *)a, *y = *(slab * const *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns n bytes from the arena
+char* slabAlloc(slabArena *a, size_t n){
+    if (!a->cur || a->cur->cap - a->cur->used < n) { // current slab is full --> start a new one
+        size_t cap = n > TEXIT_SLAB_SIZE ? n : TEXIT_SLAB_SIZE;
+        slab *sl = malloc(sizeof(slab) + cap);
+        if (!sl) die("malloc");
+        sl->used = 0;
+        sl->cap = cap;
+        sl->live = 0;
+
+        if (a->count == a->cap) {
+            a->cap = a->cap ? a->cap * 2 : 16;
+            a->slabs = realloc(a->slabs, sizeof(slab *) * a->cap);
+            if (!a->slabs) die("realloc");
+        }
+        // keep the array sorted by address
+        int i = a->count;
+        while (i > 0 && a->slabs[i - 1] > sl) {
+            a->slabs[i] = a->slabs[i - 1];
+            i--;
+        }
+        a->slabs[i] = sl;
+        a->count++;
+        a->cur = sl;
+    }
+
+    char *p = a->cur->data + a->cur->used;
+    a->cur->used += n;
+    a->cur->live++;
+    return p;
+}
+
+// Gives back memory that came from slabAlloc. The slab it belongs to is found
+// with a binary search, and freed once nothing in it is used anymore
+void slabRelease(slabArena *a, char *p){
+    int lo = 0, hi = a->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        slab *sl = a->slabs[mid];
+        if (p < sl->data) hi = mid - 1;
+        else if (p >= sl->data + sl->cap) lo = mid + 1;
+        else {
+            if (--sl->live > 0) return;
+            if (a->cur == sl) a->cur = NULL;
+            free(sl);
+            memmove(&a->slabs[mid], &a->slabs[mid + 1], sizeof(slab *) * (a->count - mid - 1));
+            a->count--;
+            return;
+        }
+    }
+}
+
+// Frees the whole arena at once
+void slabFree(slabArena *a){
+    int i;
+    for (i = 0; i < a->count; i++) free(a->slabs[i]);
+    free(a->slabs);
+    a->slabs = NULL;
+    a->count = a->cap = 0;
+    a->cur = NULL;
+}
+
+// Moves all the slabs of src into dst, src is left empty
+void slabMerge(slabArena *dst, slabArena *src){
+    if (src->count == 0) return;
+    if (dst->count + src->count > dst->cap) {
+        dst->cap = dst->count + src->count;
+        dst->slabs = realloc(dst->slabs, sizeof(slab *) * dst->cap);
+        if (!dst->slabs) die("realloc");
+    }
+    memcpy(&dst->slabs[dst->count], src->slabs, sizeof(slab *) * src->count);
+    dst->count += src->count;
+    qsort(dst->slabs, dst->count, sizeof(slab *), slabCompare);
+
+    free(src->slabs);
+    src->slabs = NULL;
+    src->count = src->cap = 0;
+    src->cur = NULL;
+}
+
 /*** Row operations ***/
 
 int editorRowCxToRx(erow *row, int cx) {
     int rx = 0;
     int j;
+    editorRowTouch(row);
     for (j = 0; j < cx; j++) {
         if (row->chars[j] == '\t')
             rx += (TEXIT_TAB_STOP - 1) - (rx % TEXIT_TAB_STOP);
@@ -276,7 +570,19 @@ void editorUpdateRow(erow *row) {
         if (row->chars[j] == '\t') tabs++;
 
     // Rebuilding the render from scratch, we don't care about old screen representation
-    free(row->render);
+    if (row->render != row->chars) free(row->render);
+
+    // Nothing to expand --> the render would be an exact copy of chars, so just share them
+    if (tabs == 0) {
+        row->render = row->chars;
+        row->rsize = row->size;
+        return;
+    }
+
+    if ((size_t)row->size + (size_t)tabs*(TEXIT_TAB_STOP-1) > INT_MAX) {
+        errno = EFBIG;
+        die("editorUpdateRow");
+    }
     row->render = malloc(row->size + tabs*(TEXIT_TAB_STOP-1) + 1); // account space for tabs as well
 
     // index of the render chars
@@ -294,66 +600,177 @@ void editorUpdateRow(erow *row) {
     row->rsize = idx; // setting the size of the render chars
 }
 
-// Function that 
-void editorAppendRow(char *s, size_t len) {
-    // We reallocate the array memory space each row
-    // The last realloc call will be the amount of rows there are in the file
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1)); // Initially E.numrows = 0
-    int at = E.numrows; // index of the current row in the array of all rows
-
-    E.row[at].size = len; // set the length of the current row
-    E.row[at].chars = malloc(len + 1); // allocate memory for the row. (+1 for '\0')
-
-    memcpy(E.row[at].chars, s, len); // copy the row
-    E.row[at].chars[len] = '\0'; // null-terminate
+// Fills a fresh row struct with a copy of the given chars and builds its render.
+// With a pool, short rows take their memory from it instead of malloc
+void editorInitRow(erow *row, const char *s, size_t len, slabArena *pool) {
+    if (len > INT_MAX) { // the row size is an int
+        errno = EFBIG;
+        die("editorInitRow");
+    }
+    row->size = len; // set the length of the row
+    row->off = -1; // not in the file yet
+    row->changed = 1;
+    row->packed = 0;
+    row->ref = 0;
+    row->pooled = pool && len < TEXIT_SHORT_LINE;
+    if (row->pooled) row->chars = slabAlloc(pool, len + 1);
+    else row->chars = malloc(len + 1); // allocate memory for the row. (+1 for '\0')
+
+    memcpy(row->chars, s, len); // copy the row
+    row->chars[len] = '\0'; // null-terminate
 
     // Initialize the render contents, that will be used to show the file contents in the terminal
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    editorUpdateRow(&E.row[at]);
+    row->rsize = 0;
+    row->render = NULL;
+    editorUpdateRow(row);
+}
 
-    E.numrows++; // increment to indicate another row that was appended
-    E.dirty++; // 
+// Bytes taken by the row's chars and render, 0 while it's packed
+size_t editorRowCost(erow *row){
+    if (row->packed) return 0;
+    return row->size + 1 + (row->render != row->chars ? row->rsize + 1 : 0);
 }
 
 void editorFreeRow(erow *row){
-    free(row->render);
-    free(row->chars);
+    if (row->packed) { // nothing of its own to free, it only leaves its block
+        editorColdRelease(row->cold);
+        return;
+    }
+    E.cold.resident -= editorRowCost(row);
+    if (row->render != row->chars) free(row->render);
+    if (row->pooled) slabRelease(&E.pool, row->chars);
+    else free(row->chars);
+}
+
+// Has to be called before a row's contents change: brings the row back if it was packed,
+// and takes it out of the word index and the memory count until editorRowEndEdit()
+void editorRowBeginEdit(erow *row){
+    editorRowTouch(row);
+    wordIndexRemoveRow(row - E.row);
+    E.cold.resident -= editorRowCost(row);
+}
+
+void editorRowEndEdit(erow *row){
+    E.cold.resident += editorRowCost(row);
+    wordIndexAddRow(row - E.row);
+}
+
+// Resizes the row's chars buffer to cap bytes, the contents are kept.
+// Arena chars can't be realloc'd, so the row gets its own malloc'd copy first
+void editorRowResize(erow *row, size_t cap){
+    // chars are about to move, a render that shares them has to go.
+    // editorUpdateRow() will build it again
+    if (row->render == row->chars) row->render = NULL;
+
+    if (cap > (size_t)INT_MAX + 1) {
+        errno = EFBIG;
+        die("editorRowResize");
+    }
+    if (row->pooled) {
+        char *chars = malloc(cap);
+        if (!chars) die("malloc");
+        memcpy(chars, row->chars, row->size + 1); // rows only ever grow here
+        slabRelease(&E.pool, row->chars);
+        row->chars = chars;
+        row->pooled = 0;
+    }
+    else {
+        row->chars = realloc(row->chars, cap);
+        if (!row->chars) die("realloc");
+    }
+}
+
+// Makes sure E.row has room for at least n rows.
+// The capacity at least doubles every time, so adding rows one by one stays cheap
+void editorReserveRows(int n){
+    if (n <= E.rowcap) return;
+    int cap = E.rowcap > INT_MAX / 2 ? INT_MAX : E.rowcap ? E.rowcap * 2 : 16;
+    if (cap < n) cap = n;
+
+    erow *row = realloc(E.row, sizeof(erow) * cap);
+    if (!row) die("realloc");
+    E.row = row;
+    E.rowcap = cap;
+}
+
+// Replaces the ndel rows starting at index `at` with nins new rows.
+// New row i gets the contents lines[i] with length lens[i].
+// Whatever the amounts, the rows after the spliced range are moved only once,
+// so inserting or deleting k rows costs O(n + k) and not O(n * k)
+void editorSpliceRows(int at, int ndel, char **lines, size_t *lens, int nins){
+    if (at < 0 || at > E.numrows) return; // checks the vertical boundary
+    if (ndel < 0) ndel = 0;
+    if (ndel > E.numrows - at) ndel = E.numrows - at;
+    if (ndel == 0 && nins == 0) return;
+
+    int j;
+    for (j = 0; j < ndel; j++) {
+        wordIndexRemoveRow(at + j);
+        editorFreeRow(&E.row[at + j]); // Free the deleted rows' contents
+    }
+
+    editorReserveRows(E.numrows - ndel + nins);
+
+    // Move all the rows that come after the spliced range, to right after the new rows
+    memmove(&E.row[at + nins], &E.row[at + ndel], sizeof(erow) * (E.numrows - at - ndel));
+
+    for (j = 0; j < nins; j++) {
+        editorInitRow(&E.row[at + j], lines[j], lens[j], NULL);
+        E.row[at + j].ref = 1; // new rows are in use, the packer leaves them alone for now
+        E.cold.resident += editorRowCost(&E.row[at + j]);
+    }
+
+    E.numrows += nins - ndel;
+    wordIndexSplice(at, ndel, nins);
+    if (ndel > 0) E.cold.idle = 0; // rows moved up towards the screen, others may be cold now
+    E.dirty++; // changes made
+}
+
+// Inserts a single row at index `at`, the rows from `at` onwards are pushed one down
+void editorInsertRow(int at, char *s, size_t len){
+    editorSpliceRows(at, 0, &s, &len, 1);
+}
+
+// Function that adds a row at the very end of the file
+void editorAppendRow(char *s, size_t len) {
+    editorInsertRow(E.numrows, s, len);
 }
 
 // Deletion of the row if we backspace at the start of a line
 void editorDelRow(int at){
     if(at < 0 || at >= E.numrows) return; // checks the vertical boundary
-    editorFreeRow(&E.row[at]); // Free the row struct contents
-    // Move all the rows that come after the deleted row up by one,
-    memmove(&E.row[at], &E.row[at+1], sizeof(erow) * (E.numrows -at -1));
-    E.numrows--; // row deleted
-    E.dirty++; // changes made
+    editorSpliceRows(at, 1, NULL, NULL, 0);
 }
 
 void editorRowInsertChar(erow *row, int at, int c) {
     if (at < 0 || at > row->size) at = row->size;
+    editorRowBeginEdit(row); // the row's words are about to change
     // allocate new memory for the inserted char
-    row->chars = realloc(row->chars, row->size + 2); // +2 for new char & null terminator 
+    editorRowResize(row, row->size + 2); // +2 for new char & null terminator 
     // copy chars starting from the index [at] to the index [at+1]
     memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
 
     row->size++; // update row size, as a char was inserted
     row->chars[at] = c; // insert the character
+    row->changed = 1;
     editorUpdateRow(row);
+    editorRowEndEdit(row);
     E.dirty++;
 }
 
 void editorRowAppendString(erow *row, char *s, size_t len){
+    editorRowBeginEdit(row);
     // reallocate memory for all the chars stored in the deleted row 
-    row->chars = realloc(row->chars, row->size + len + 1); // +1 for null byte
+    editorRowResize(row, row->size + len + 1); // +1 for null byte
     // Copy all the characters of the deleted row, at the end of the new row
     // Where the end is row->chars[row->size], as row->size signifies the end
     memcpy(&row->chars[row->size], s, len);
     row->size += len; // set the new corresponding length
     row->chars[row->size] = '\0'; // null-terminate
+    row->changed = 1;
 
     editorUpdateRow(row); // Update the row render contents
+    editorRowEndEdit(row);
     E.dirty++; // changes made
 }
 
@@ -362,12 +779,15 @@ void editorRowAppendString(erow *row, char *s, size_t len){
 // at: corresponds for the horizontal position of the cursor
 void editorRowDelChar(erow *row, int at){
     if (at < 0 || at >= row->size) return; // checking cursor vertical boundary
+    editorRowBeginEdit(row);
 
     // move all chars to the right of the cursor one to the left 
     memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
     row->size--; // decrease row size
+    row->changed = 1;
 
     editorUpdateRow(row); // Update the display row (render)
+    editorRowEndEdit(row);
     E.dirty++;
 
 }
@@ -382,6 +802,29 @@ void editorInsertChar(int c){
     E.cx++;
 }
 
+// Enter key. Everything right of the cursor moves to a new row below
+void editorInsertNewline(){
+    if (E.cx == 0) { // at the start of a line we just push an empty row above it
+        editorInsertRow(E.cy, "", 0);
+    }
+    else {
+        erow *row = &E.row[E.cy];
+        editorRowTouch(row);
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+
+        // Inserting may have moved E.row around, so get the row again
+        row = &E.row[E.cy];
+        editorRowBeginEdit(row);
+        row->size = E.cx; // cut the row at the cursor
+        row->chars[row->size] = '\0';
+        row->changed = 1;
+        editorUpdateRow(row);
+        editorRowEndEdit(row);
+    }
+    E.cy++; // the cursor goes to the start of the new line
+    E.cx = 0;
+}
+
 
 void editorDelChar(){
     if(E.cy == E.numrows) return; // can't backspace nonexistent row
@@ -397,6 +840,7 @@ void editorDelChar(){
     // backspacing at the beginning of the row
     else{
         E.cx = E.row[E.cy - 1].size; // set the cursor to the end of the line of the prev row
+        editorRowTouch(row);
         // Firstly we append all the characters of the row on which we are
         // and only then free the row and row's chars & render
         editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
@@ -407,20 +851,1262 @@ void editorDelChar(){
     return;
 }
 
+/*** Threads ***/
+
+// How many threads are worth starting for `work` units,
+// given that a thread should get at least `minPerThread` of them
+int editorThreadCount(size_t work, size_t minPerThread){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (cpus > TEXIT_MAX_THREADS) cpus = TEXIT_MAX_THREADS;
+
+    size_t n = work / minPerThread; // too little work --> fewer threads
+    if (n < 1) n = 1;
+    if (n > (size_t)cpus) n = cpus;
+    return n;
+}
+
+// Runs fn on each of the n jobs in the `jobs` array, every job on its own thread.
+// The first job runs on the calling thread, and we only return when all of them are done.
+// If a thread can't be started its job simply runs on the calling thread instead.
+void editorRunParallel(void *(*fn)(void *), void *jobs, size_t jobsize, int n){
+    pthread_t tid[TEXIT_MAX_THREADS];
+    int started[TEXIT_MAX_THREADS];
+    int i;
+
+    for (i = 1; i < n; i++)
+        started[i] = pthread_create(&tid[i], NULL, fn, (char *)jobs + i * jobsize) == 0;
+
+    fn(jobs);
+
+    for (i = 1; i < n; i++) {
+        if (started[i]) pthread_join(tid[i], NULL);
+        else fn((char *)jobs + i * jobsize);
+    }
+}
+
+/*** Line indexer ***/
+
+// The line's text ends before the '\n' at eol, and before any '\r's right in front of it.
+// This way CRLF files are cleaned up in the same pass that finds the newlines
+size_t indexLineEnd(const char *buf, size_t eol){
+    while (eol > 0 && buf[eol - 1] == '\r') eol--;
+    return eol;
+}
+
+// Records a newline found at offset eol
+void indexPush(indexChunk *c, size_t eol){
+    if (c->count == c->cap) { // out of space --> double the table
+        c->cap = c->cap ? c->cap * 2 : 1024;
+        c->lines = realloc(c->lines, sizeof(lineIndex) * c->cap);
+        if (!c->lines) die("realloc");
+    }
+    c->lines[c->count].eol = eol;
+    c->lines[c->count].end = indexLineEnd(c->buf, eol);
+    c->count++;
+}
+
+// Plain byte by byte scan, used when the CPU has no SIMD we know about
+void indexScanScalar(indexChunk *c){
+    size_t i;
+    for (i = c->from; i < c->to; i++)
+        if (c->buf[i] == '\n') indexPush(c, i);
+}
+
+#ifdef TEXIT_HAVE_X86
+// Compares 16 bytes at a time against '\n'. movemask squeezes the comparison
+// into a 16 bit mask, one bit per byte, and each set bit is a newline
+__attribute__((target("sse2")))
+void indexScanSSE2(indexChunk *c){
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = c->from;
+
+    for (; i + 16 <= c->to; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(c->buf + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while (mask) { // walk the set bits from lowest to highest
+            indexPush(c, i + __builtin_ctz(mask));
+            mask &= mask - 1; // clear the lowest set bit
+        }
+    }
+    for (; i < c->to; i++) // leftover tail, less than 16 bytes
+        if (c->buf[i] == '\n') indexPush(c, i);
+}
+
+// Same as the SSE2 version, but 32 bytes at a time
+__attribute__((target("avx2")))
+void indexScanAVX2(indexChunk *c){
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = c->from;
+
+    for (; i + 32 <= c->to; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(c->buf + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        while (mask) {
+            indexPush(c, i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < c->to; i++)
+        if (c->buf[i] == '\n') indexPush(c, i);
+}
+#endif
+
+// Picks the widest newline scanner this CPU supports
+void (*indexPickScanner())(indexChunk *){
+#ifdef TEXIT_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return indexScanAVX2;
+    if (__builtin_cpu_supports("sse2")) return indexScanSSE2;
+#endif
+    return indexScanScalar;
+}
+
+void *indexChunkWorker(void *arg){
+    indexChunk *c = arg;
+    c->scan(c);
+    return NULL;
+}
+
+// Builds the line-offset table of buf.
+// Returns a malloc'd table with one entry per line and stores the amount of lines in *count
+lineIndex* editorIndexLines(const char *buf, size_t len, size_t *count){
+    indexChunk chunks[TEXIT_MAX_THREADS];
+    int n = editorThreadCount(len, TEXIT_INDEX_CHUNK_MIN);
+    void (*scan)(indexChunk *) = indexPickScanner();
+    int i;
+
+    // Split the buffer into n chunks of (almost) the same size
+    for (i = 0; i < n; i++) {
+        chunks[i].buf = buf;
+        chunks[i].from = len * i / n;
+        chunks[i].to = len * (i + 1) / n;
+        chunks[i].lines = NULL;
+        chunks[i].count = chunks[i].cap = 0;
+        chunks[i].scan = scan;
+    }
+    editorRunParallel(indexChunkWorker, chunks, sizeof(indexChunk), n);
+
+    // Merge the chunk tables. The chunks are in file order, so gluing them together is enough
+    size_t total = 0;
+    for (i = 0; i < n; i++) total += chunks[i].count;
+
+    lineIndex *lines = malloc(sizeof(lineIndex) * (total + 1)); // +1 for a possible last line without '\n'
+    if (!lines) die("malloc");
+    size_t at = 0;
+    for (i = 0; i < n; i++) {
+        if (chunks[i].count)
+            memcpy(&lines[at], chunks[i].lines, sizeof(lineIndex) * chunks[i].count);
+        at += chunks[i].count;
+        free(chunks[i].lines);
+    }
+
+    // The last line of a file doesn't have to end with '\n', but it's still a line
+    if (len > 0 && buf[len - 1] != '\n') {
+        size_t start = total ? lines[total - 1].eol + 1 : 0;
+        size_t end = indexLineEnd(buf, len);
+        lines[total].eol = len;
+        lines[total].end = end < start ? start : end;
+        total++;
+    }
+
+    *count = total;
+    return lines;
+}
+
+void *rowBuildWorker(void *arg){
+    rowBuildJob *job = arg;
+    size_t i;
+    for (i = job->from; i < job->to; i++) {
+        // a line starts right after the newline of the previous one
+        size_t start = i ? job->lines[i - 1].eol + 1 : 0;
+        erow *row = &job->rows[i];
+        editorInitRow(row, job->buf + start, job->lines[i].end - start, &job->pool);
+        job->resident += editorRowCost(row);
+
+        // Saving writes chars + '\n'. If there were '\r's or the '\n' is missing
+        // the row on disk will change, even if nobody touches it
+        row->off = start;
+        row->changed = job->lines[i].end != job->lines[i].eol || job->lines[i].eol >= job->len;
+    }
+    return NULL;
+}
+
+// Appends all the lines in buf as rows.
+// The E.row array grows once, and the rows themselves are built in parallel.
+// Short rows are packed into arena slabs so they don't cost a malloc each
+void editorLoadBuffer(const char *buf, size_t len){
+    size_t count;
+    lineIndex *lines = editorIndexLines(buf, len, &count);
+
+    // Rows are indexed by int
+    if (count > (size_t)(INT_MAX - E.numrows)) {
+        errno = EFBIG;
+        die("editorLoadBuffer");
+    }
+
+    if (count > 0) {
+        editorReserveRows(E.numrows + count);
+
+        rowBuildJob jobs[TEXIT_MAX_THREADS];
+        int n = editorThreadCount(count, TEXIT_BUILD_ROWS_MIN);
+        int i;
+        for (i = 0; i < n; i++) {
+            jobs[i].buf = buf;
+            jobs[i].len = len;
+            jobs[i].lines = lines;
+            jobs[i].from = count * i / n;
+            jobs[i].to = count * (i + 1) / n;
+            jobs[i].rows = &E.row[E.numrows];
+            slabArena pool = SLAB_ARENA_INIT;
+            jobs[i].pool = pool;
+            jobs[i].resident = 0;
+        }
+        editorRunParallel(rowBuildWorker, jobs, sizeof(rowBuildJob), n);
+
+        for (i = 0; i < n; i++) {
+            slabMerge(&E.pool, &jobs[i].pool);
+            E.cold.resident += jobs[i].resident;
+        }
+
+        E.numrows += count;
+    }
+
+    free(lines);
+}
+
+/*** Word index ***/
+
+int isWordChar(int c){
+    return isalnum(c) || c == '_';
+}
+
+// Finds the next word in s[*pos, len). Returns its start, or -1 if there are no more.
+// *pos is moved past the word and its length is stored in *wlen
+int nextWord(const char *s, int len, int *pos, int *wlen){
+    int i = *pos;
+    while (i < len && !isWordChar((unsigned char)s[i])) i++;
+    if (i == len) return -1;
+
+    int start = i;
+    while (i < len && isWordChar((unsigned char)s[i])) i++;
+    *pos = i;
+    *wlen = i - start;
+    return start;
+}
+
+// FNV-1a hash of the word
+unsigned int wordHash(const char *w, int len){
+    unsigned int h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)w[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Orders words like strcmp: a word comes right before the longer words it starts
+int wordCompare(const char *a, int alen, const char *b, int blen){
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    return c ? c : alen - blen;
+}
+
+// Finds the first word >= w in the sorted list: block *b, position *pos in it.
+// *pos can be the end of the last block. The list must not be empty
+void wordListFind(const char *w, int len, int *b, int *pos){
+    wordIndex *wi = &E.words;
+    int lo = 0, hi = wi->nblocks - 1; // the first block whose last word is >= w, or the last one
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        wordBlock *blk = wi->blocks[mid];
+        if (wordCompare(blk->word[blk->n - 1], blk->len[blk->n - 1], w, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    wordBlock *blk = wi->blocks[lo];
+    int l = 0, h = blk->n;
+    while (l < h) {
+        int mid = (l + h) / 2;
+        if (wordCompare(blk->word[mid], blk->len[mid], w, len) < 0) l = mid + 1;
+        else h = mid;
+    }
+    *b = lo;
+    *pos = l;
+}
+
+// Puts a new empty block at position b of the list
+wordBlock* wordListAddBlock(int b){
+    wordIndex *wi = &E.words;
+    if (wi->nblocks == wi->blockcap) {
+        wi->blockcap = wi->blockcap ? wi->blockcap * 2 : 16;
+        wi->blocks = realloc(wi->blocks, sizeof(wordBlock *) * wi->blockcap);
+        if (!wi->blocks) die("realloc");
+    }
+    wordBlock *blk = malloc(sizeof(wordBlock));
+    if (!blk) die("malloc");
+    blk->n = 0;
+    memmove(&wi->blocks[b + 1], &wi->blocks[b], sizeof(wordBlock *) * (wi->nblocks - b));
+    wi->blocks[b] = blk;
+    wi->nblocks++;
+    return blk;
+}
+
+void wordListInsert(const char *w, int len){
+    wordIndex *wi = &E.words;
+    if (wi->nblocks == 0) wordListAddBlock(0);
+    int b, pos;
+    wordListFind(w, len, &b, &pos);
+
+    wordBlock *blk = wi->blocks[b];
+    if (blk->n == TEXIT_WORD_BLOCK) { // full --> split it in half
+        int half = TEXIT_WORD_BLOCK / 2;
+        wordBlock *next = wordListAddBlock(b + 1);
+        memcpy(next->word, &blk->word[half], sizeof(char *) * (blk->n - half));
+        memcpy(next->len, &blk->len[half], blk->n - half);
+        next->n = blk->n - half;
+        blk->n = half;
+        if (pos > half) {
+            blk = next;
+            pos -= half;
+        }
+    }
+    memmove(&blk->word[pos + 1], &blk->word[pos], sizeof(char *) * (blk->n - pos));
+    memmove(&blk->len[pos + 1], &blk->len[pos], blk->n - pos);
+    blk->word[pos] = w;
+    blk->len[pos] = len;
+    blk->n++;
+}
+
+void wordListRemove(const char *w, int len){
+    wordIndex *wi = &E.words;
+    int b, pos;
+    wordListFind(w, len, &b, &pos);
+
+    wordBlock *blk = wi->blocks[b];
+    memmove(&blk->word[pos], &blk->word[pos + 1], sizeof(char *) * (blk->n - pos - 1));
+    memmove(&blk->len[pos], &blk->len[pos + 1], blk->n - pos - 1);
+    if (--blk->n == 0) { // empty blocks would break wordListFind()
+        free(blk);
+        memmove(&wi->blocks[b], &wi->blocks[b + 1], sizeof(wordBlock *) * (wi->nblocks - b - 1));
+        wi->nblocks--;
+    }
+}
+
+// Slot of the word in the hash table: either its entry or the empty slot it would go into
+wordEntry* wordIndexSlot(wordEntry *table, int size, const char *w, int len){
+    unsigned int i = wordHash(w, len) & (size - 1);
+    while (table[i].word &&
+           (table[i].len != len || memcmp(table[i].word, w, len) != 0))
+        i = (i + 1) & (size - 1); // linear probing
+    return &table[i];
+}
+
+// Doubles the hash table and puts every entry into its new slot
+void wordIndexGrow(){
+    wordIndex *wi = &E.words;
+    int size = wi->size ? wi->size * 2 : 1024;
+    wordEntry *table = calloc(size, sizeof(wordEntry));
+    if (!table) die("calloc");
+
+    int i;
+    for (i = 0; i < wi->size; i++)
+        if (wi->table[i].word)
+            *wordIndexSlot(table, size, wi->table[i].word, wi->table[i].len) = wi->table[i];
+
+    free(wi->table);
+    wi->table = table;
+    wi->size = size;
+}
+
+// Returns the entry of the word, NULL if it isn't in the index and create is 0
+wordEntry* wordIndexLookup(const char *w, int len, int create){
+    wordIndex *wi = &E.words;
+    if (wi->size == 0) {
+        if (!create) return NULL;
+        wordIndexGrow();
+    }
+
+    wordEntry *e = wordIndexSlot(wi->table, wi->size, w, len);
+    if (e->word || !create) return e->word ? e : NULL;
+
+    if ((wi->count + 1) * 2 > wi->size) { // keep the table at most half full
+        wordIndexGrow();
+        e = wordIndexSlot(wi->table, wi->size, w, len);
+    }
+    char *copy = slabAlloc(&wi->strings, len);
+    memcpy(copy, w, len);
+    e->word = copy;
+    e->len = len;
+    e->labels = NULL;
+    e->nrows = e->cap = 0;
+    e->pass = 0;
+    wi->count++;
+    wordListInsert(copy, len);
+    return e;
+}
+
+// Takes a word without rows out of the index. Linear probing can't just leave a hole,
+// so the entries after it in the same run are moved back where they can be found
+void wordIndexDelete(wordEntry *e){
+    wordIndex *wi = &E.words;
+    wordListRemove(e->word, e->len);
+    slabRelease(&wi->strings, (char *)e->word);
+    free(e->labels);
+
+    unsigned int mask = wi->size - 1;
+    unsigned int hole = e - wi->table, j = hole;
+    while (1) {
+        j = (j + 1) & mask;
+        wordEntry *next = &wi->table[j];
+        if (!next->word) break;
+        // next can fill the hole unless its own slot lies between the hole and j
+        unsigned int home = wordHash(next->word, next->len) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            wi->table[hole] = *next;
+            hole = j;
+        }
+    }
+    wi->table[hole].word = NULL;
+    wi->table[hole].labels = NULL; // empty slots own nothing, see wordIndexReset()
+    wi->count--;
+}
+
+// Index of the first posting >= label
+int wordEntryFind(wordEntry *e, unsigned int label){
+    int lo = 0, hi = e->nrows;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (e->labels[mid] < label) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Iterates over the words of row `at`, adding (add = 1) or removing (add = 0) the row's postings
+void wordIndexUpdateRow(int at, int add){
+    erow *row = &E.row[at];
+    const char *chars = editorRowChars(row); // packed rows are read without unpacking them
+    unsigned int label = E.words.label[at];
+    int pos = 0, wlen, start;
+    while ((start = nextWord(chars, row->size, &pos, &wlen)) != -1) {
+        if (wlen > TEXIT_WORD_MAX) continue;
+        wordEntry *e = wordIndexLookup(&chars[start], wlen, add);
+        if (!e) continue;
+
+        // rows are mostly indexed in order, so most postings just go at the end
+        int i = (e->nrows == 0 || e->labels[e->nrows - 1] < label) ? e->nrows : wordEntryFind(e, label);
+        int found = i < e->nrows && e->labels[i] == label;
+        if (add && !found) {
+            if (e->nrows == e->cap) {
+                e->cap = e->cap ? e->cap * 2 : 4;
+                e->labels = realloc(e->labels, sizeof(unsigned int) * e->cap);
+                if (!e->labels) die("realloc");
+            }
+            memmove(&e->labels[i + 1], &e->labels[i], sizeof(unsigned int) * (e->nrows - i));
+            e->labels[i] = label;
+            e->nrows++;
+        }
+        else if (!add && found) {
+            memmove(&e->labels[i], &e->labels[i + 1], sizeof(unsigned int) * (e->nrows - i - 1));
+            if (--e->nrows == 0) wordIndexDelete(e); // typing leaves lots of words that are gone again
+        }
+    }
+}
+
+// Rows that the background build hasn't reached yet are left alone, it will get to them
+void wordIndexAddRow(int at){
+    if (at < E.words.built) wordIndexUpdateRow(at, 1);
+}
+
+void wordIndexRemoveRow(int at){
+    if (at < E.words.built) wordIndexUpdateRow(at, 0);
+}
+
+// Makes room for the labels of n rows
+void wordIndexReserveLabels(int n){
+    wordIndex *wi = &E.words;
+    if (n <= wi->labelcap) return;
+    int cap = wi->labelcap > INT_MAX / 2 ? INT_MAX : wi->labelcap ? wi->labelcap * 2 : 1024;
+    if (cap < n) cap = n;
+
+    unsigned int *label = realloc(wi->label, sizeof(unsigned int) * cap);
+    if (!label) die("realloc");
+    wi->label = label;
+    wi->labelcap = cap;
+}
+
+// Room between the labels rows [lo, hi) would get if they were spread evenly between
+// their neighbours. At the end of the index, room is left for the rows the build hasn't reached
+unsigned int wordIndexSpacing(int lo, int hi){
+    wordIndex *wi = &E.words;
+    unsigned int below = lo > 0 ? wi->label[lo - 1] : 0;
+    if (hi < wi->built) return (wi->label[hi] - below) / (hi - lo + 1);
+    return (UINT_MAX - below) / (E.numrows - lo + 1);
+}
+
+// Moves the postings of indexed row r to its new label. The rows of the window being
+// relabeled come one after the other, so every word's postings are rewritten front to back
+// from its cursor, and the posting lists stay sorted
+void wordIndexMoveRow(int r, unsigned int label, unsigned int below){
+    wordIndex *wi = &E.words;
+    erow *row = &E.row[r];
+    const char *chars = editorRowChars(row);
+    int pos = 0, wlen, start;
+    while ((start = nextWord(chars, row->size, &pos, &wlen)) != -1) {
+        if (wlen > TEXIT_WORD_MAX) continue;
+        wordEntry *e = wordIndexLookup(&chars[start], wlen, 0);
+        if (!e) continue;
+        if (e->pass != wi->pass) { // first row of the window with this word
+            e->pass = wi->pass;
+            e->cursor = wordEntryFind(e, below + 1);
+        }
+        if (e->cursor > 0 && e->labels[e->cursor - 1] == label) continue; // word seen twice in the row
+        e->labels[e->cursor++] = label;
+    }
+}
+
+// Spreads the labels of rows [lo, hi) evenly. Rows [skiplo, skiphi) aren't in the index yet,
+// they only get their labels
+void wordIndexRelabel(int lo, int hi, int skiplo, int skiphi){
+    wordIndex *wi = &E.words;
+    unsigned int below = lo > 0 ? wi->label[lo - 1] : 0;
+    unsigned int gap = wordIndexSpacing(lo, hi);
+    wi->pass++;
+    int r;
+    for (r = lo; r < hi; r++) {
+        unsigned int label = below + gap * (r - lo + 1);
+        if (r < skiplo || r >= skiphi) wordIndexMoveRow(r, label, below);
+        wi->label[r] = label;
+    }
+}
+
+// Labels the new rows [from, to), which are below `built` but not indexed yet.
+// If they don't fit between their neighbours, the window around them grows until
+// spreading it out leaves some room for the next rows inserted there
+void wordIndexLabelRows(int from, int to){
+    wordIndex *wi = &E.words;
+    int lo = from, hi = to;
+    unsigned int need = 1;
+    while (wordIndexSpacing(lo, hi) < need && (lo > 0 || hi < wi->built)) {
+        int w = hi - lo;
+        lo = lo > w ? lo - w : 0;
+        hi = wi->built - hi > w ? hi + w : wi->built;
+        need = TEXIT_LABEL_GAP;
+    }
+    wordIndexRelabel(lo, hi, from, to);
+}
+
+// Index of the indexed row with the given label
+int wordIndexRowOf(unsigned int label){
+    wordIndex *wi = &E.words;
+    int lo = 0, hi = wi->built - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (wi->label[mid] < label) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Called after the ndel rows at `at` were replaced with nins new rows.
+// The deleted rows are already out of the index, so the labels after them are moved along
+// and the new rows labeled and indexed. If the build was in the middle of the deleted rows, it resumes at `at`
+void wordIndexSplice(int at, int ndel, int nins){
+    wordIndex *wi = &E.words;
+    if (wi->built <= at) return;
+    if (wi->built < at + ndel) {
+        wi->built = at;
+        return;
+    }
+
+    wordIndexReserveLabels(wi->built - ndel + nins);
+    memmove(&wi->label[at + nins], &wi->label[at + ndel], sizeof(unsigned int) * (wi->built - at - ndel));
+    wi->built += nins - ndel;
+    if (nins == 0) return;
+
+    wordIndexLabelRows(at, at + nins);
+    int j;
+    for (j = at; j < at + nins; j++)
+        wordIndexUpdateRow(j, 1);
+}
+
+// Throws the whole index away, the background build starts over from row 0.
+// Used after commands that move most of the rows around
+void wordIndexReset(){
+    wordIndex *wi = &E.words;
+    int i;
+    for (i = 0; i < wi->size; i++) free(wi->table[i].labels);
+    free(wi->table);
+    slabFree(&wi->strings);
+    for (i = 0; i < wi->nblocks; i++) free(wi->blocks[i]);
+    free(wi->blocks);
+    free(wi->label);
+    wi->table = NULL;
+    wi->size = wi->count = 0;
+    wi->blocks = NULL;
+    wi->nblocks = wi->blockcap = 0;
+    wi->built = 0;
+    wi->label = NULL;
+    wi->labelcap = 0;
+}
+
+// Indexes the next batch of rows. Returns 0 once every row is in the index
+int wordIndexStep(){
+    wordIndex *wi = &E.words;
+    int from = wi->built;
+    int end = from + TEXIT_INDEX_BATCH;
+    if (end > E.numrows) end = E.numrows;
+    if (from == end) return 0;
+
+    wordIndexReserveLabels(end);
+    wi->built = end; // the rows have to be below `built` to be labeled and indexed
+    wordIndexLabelRows(from, end);
+    int r;
+    for (r = from; r < end; r++)
+        wordIndexUpdateRow(r, 1);
+    return wi->built < E.numrows;
+}
+
+// Returns where the first whole-word occurrence of word in row starts, looking from `from` on
+int rowFindWord(erow *row, int from, const char *word, int wlen){
+    int pos = from, len, at;
+    editorRowTouch(row);
+    while ((at = nextWord(row->chars, row->size, &pos, &len)) != -1)
+        if (len == wlen && memcmp(&row->chars[at], word, wlen) == 0) return at;
+    return -1;
+}
+
+// Ctrl-N: completes the word left of the cursor with the words in the index.
+// It goes as far as all the candidates agree, and lists them if they don't agree at all
+void editorCompleteWord(){
+    if (E.cy >= E.numrows) return;
+    erow *row = &E.row[E.cy];
+    editorRowTouch(row);
+
+    int start = E.cx;
+    while (start > 0 && isWordChar((unsigned char)row->chars[start - 1])) start--;
+    int plen = E.cx - start;
+    if (plen == 0) {
+        editorSetStatusMessage("Nothing to complete");
+        return;
+    }
+
+    char prefix[TEXIT_WORD_MAX + 1];
+    if (plen > TEXIT_WORD_MAX) return;
+    memcpy(prefix, &row->chars[start], plen);
+
+    // The candidates are one run of the sorted word list: from the first word >= prefix
+    // up to the first word >= prefix + "\xff", as word chars are all below 0xff
+    wordIndex *wi = &E.words;
+    int b = 0, pos = 0, endb = 0, endpos = 0;
+    if (wi->nblocks) {
+        wordListFind(prefix, plen, &b, &pos);
+        prefix[plen] = '\xff';
+        wordListFind(prefix, plen + 1, &endb, &endpos);
+    }
+    int matches = 0, i;
+    for (i = b; i <= endb && i < wi->nblocks; i++)
+        matches += (i == endb ? endpos : wi->blocks[i]->n) - (i == b ? pos : 0);
+
+    const char *first = NULL; // longest common prefix of the candidates is first[0, common)
+    int common = 0;
+    char list[80] = "";
+    int run = matches;
+    for (i = 0; i < run; i++) {
+        if (pos == wi->blocks[b]->n) {
+            b++;
+            pos = 0;
+        }
+        wordBlock *blk = wi->blocks[b];
+        const char *w = blk->word[pos];
+        int wlen = blk->len[pos++];
+        if (wlen == plen) { // the prefix is a word of its own, it comes first
+            matches--;
+            continue;
+        }
+        if (!first) { // sorted, so the common prefix of the run is that of its first and last word
+            first = w;
+            wordBlock *last = endpos ? wi->blocks[endb] : wi->blocks[endb - 1];
+            const char *lw = last->word[endpos ? endpos - 1 : last->n - 1];
+            int llen = last->len[endpos ? endpos - 1 : last->n - 1];
+            common = plen;
+            while (common < wlen && common < llen && w[common] == lw[common]) common++;
+        }
+        int used = strlen(list);
+        if (used + wlen + 2 >= (int)sizeof(list)) break; // the list is only a glimpse
+        snprintf(&list[used], sizeof(list) - used, "%.*s ", wlen, w);
+    }
+
+    const char *partial = E.words.built < E.numrows ? " (index still building)" : "";
+    if (!first) {
+        editorSetStatusMessage("No completions%s", partial);
+        return;
+    }
+    if (common == plen) { // candidates split right away, so show some of them
+        editorSetStatusMessage("%d: %s", matches, list);
+        return;
+    }
+
+    // Inserting updates the index, which can move or free first, so work from a copy.
+    // insertChar moves the cursor along as it goes
+    char rest[TEXIT_WORD_MAX];
+    memcpy(rest, &first[plen], common - plen);
+    for (i = 0; i < common - plen; i++)
+        editorInsertChar(rest[i]);
+    if (matches > 1) editorSetStatusMessage("%d completions%s", matches, partial);
+}
+
+// Ctrl-W: moves the cursor to the next whole-word occurrence of the word under it,
+// wrapping around at the end of the file
+void editorJumpToWord(){
+    if (E.cy >= E.numrows) return;
+    erow *row = &E.row[E.cy];
+    editorRowTouch(row);
+
+    // the word the cursor is on, or the one right before it
+    int start = E.cx, end = E.cx;
+    while (start > 0 && isWordChar((unsigned char)row->chars[start - 1])) start--;
+    while (end < row->size && isWordChar((unsigned char)row->chars[end])) end++;
+    int wlen = end - start;
+    if (wlen == 0 || wlen > TEXIT_WORD_MAX) {
+        editorSetStatusMessage("No word under the cursor");
+        return;
+    }
+
+    wordEntry *e = wordIndexLookup(&row->chars[start], wlen, 0);
+    if (!e || e->nrows == 0) { // the word's row may not be indexed yet
+        editorSetStatusMessage("Word not indexed yet");
+        return;
+    }
+    char word[TEXIT_WORD_MAX];
+    memcpy(word, &row->chars[start], wlen);
+
+    // The rest of this row first, then the next row that has the word.
+    // After the last one we wrap around to the first, which can be this row again
+    wordIndex *wi = &E.words;
+    int i = E.cy < wi->built ? wordEntryFind(e, wi->label[E.cy]) : e->nrows;
+    int r = E.cy, at = -1;
+    if (i < e->nrows && e->labels[i] == wi->label[E.cy]) {
+        at = rowFindWord(row, end, word, wlen);
+        i++;
+    }
+    if (at == -1) {
+        r = wordIndexRowOf(e->labels[i < e->nrows ? i : 0]);
+        at = rowFindWord(&E.row[r], 0, word, wlen);
+    }
+    if (at == -1) return; // can't happen, the postings are exact
+
+    E.cy = r;
+    E.cx = at;
+    editorSetStatusMessage("'%.*s' is on %d rows%s", wlen, word, e->nrows,
+        E.words.built < E.numrows ? " (index still building)" : "");
+}
+
+/*** Cold rows ***/
+
+// Writes n as the rest of an LZ length: as many 255s as fit, then what's left
+unsigned char *lzPutLength(unsigned char *op, size_t n){
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// One sequence of the compressed stream: a token byte with the amount of literals
+// and the match length (4 bits each, 15 means more length bytes follow), the literals,
+// then the match as a 2 byte distance back into the output. The last one has no match
+unsigned char *lzPutSequence(unsigned char *op, const unsigned char *lit, size_t litlen,
+                             size_t dist, size_t matchlen){
+    size_t ml = matchlen ? matchlen - LZ_MIN_MATCH : 0;
+    *op++ = ((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15);
+    if (litlen >= 15) op = lzPutLength(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (matchlen) {
+        *op++ = dist & 0xff;
+        *op++ = dist >> 8;
+        if (ml >= 15) op = lzPutLength(op, ml - 15);
+    }
+    return op;
+}
+
+// Simple LZ77 compressor in the spirit of LZ4: a hash table finds an earlier spot
+// with the same 4 bytes, and the match is extended as far as it goes.
+// out needs room for n + n / 255 + 16 bytes. Returns the compressed size
+size_t lzCompress(const unsigned char *in, size_t n, unsigned char *out){
+    static unsigned int table[1 << LZ_HASH_BITS]; // position + 1 of the last sequence with that hash
+    memset(table, 0, sizeof(table));
+
+    unsigned char *op = out;
+    size_t ip = 0, anchor = 0; // anchor: start of the literals not written yet
+    while (ip + LZ_MIN_MATCH <= n) {
+        unsigned int seq;
+        memcpy(&seq, in + ip, 4);
+        unsigned int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = ip + 1;
+
+        if (cand && ip - (cand - 1) <= 0xffff && memcmp(in + cand - 1, in + ip, 4) == 0) {
+            size_t m = cand - 1, len = LZ_MIN_MATCH;
+            while (ip + len < n && in[m + len] == in[ip + len]) len++;
+            op = lzPutSequence(op, in + anchor, ip - anchor, ip - m, len);
+            ip += len;
+            anchor = ip;
+        }
+        else ip++;
+    }
+    op = lzPutSequence(op, in + anchor, n - anchor, 0, 0);
+    return op - out;
+}
+
+// Reads the rest of an LZ length. Returns -1 if the stream ends in the middle of it
+int lzGetLength(const unsigned char **ip, const unsigned char *iend, size_t *n){
+    unsigned char b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Undoes lzCompress(). Returns 0 if exactly outlen bytes came out, -1 for a broken stream
+int lzDecompress(const unsigned char *in, size_t inlen, unsigned char *out, size_t outlen){
+    const unsigned char *ip = in, *iend = in + inlen;
+    size_t op = 0;
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && lzGetLength(&ip, iend, &lit) == -1) return -1;
+        if (lit > (size_t)(iend - ip) || lit > outlen - op) return -1;
+        memcpy(out + op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break; // the last sequence has no match
+
+        if (iend - ip < 2) return -1;
+        size_t dist = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && lzGetLength(&ip, iend, &len) == -1) return -1;
+        len += LZ_MIN_MATCH;
+        if (dist == 0 || dist > op || len > outlen - op) return -1;
+
+        // byte by byte, the match may overlap the bytes it is producing
+        size_t k;
+        for (k = 0; k < len; k++, op++) out[op] = out[op - dist];
+    }
+    return op == outlen ? 0 : -1;
+}
+
+// Makes sure the block is the one unpacked in the cache
+void editorColdLoad(coldBlock *blk){
+    if (E.cold.cached == blk) {
+        E.cold.hits++;
+        return;
+    }
+    E.cold.misses++;
+    if (E.cold.cachecap < blk->rawlen) {
+        E.cold.cache = realloc(E.cold.cache, blk->rawlen);
+        if (!E.cold.cache) die("realloc");
+        E.cold.cachecap = blk->rawlen;
+    }
+    if (blk->complen == blk->rawlen) // stored as is
+        memcpy(E.cold.cache, blk->data, blk->rawlen);
+    else if (lzDecompress(blk->data, blk->complen, E.cold.cache, blk->rawlen) == -1) {
+        errno = EIO;
+        die("lzDecompress");
+    }
+    E.cold.cached = blk;
+}
+
+// One of the block's rows isn't packed anymore
+void editorColdRelease(coldBlock *blk){
+    if (--blk->live > 0) return;
+    E.cold.rawbytes -= blk->rawlen;
+    E.cold.compbytes -= blk->complen;
+    if (E.cold.cached == blk) E.cold.cached = NULL;
+    free(blk);
+}
+
+// Packs rows [from, to) into one compressed block.
+// Returns the amount of rows packed, 0 if they are all empty and there is nothing to gain
+int editorPackRows(int from, int to){
+    size_t rawlen = 0;
+    int j;
+    for (j = from; j < to; j++) rawlen += E.row[j].size;
+    if (rawlen == 0) return 0;
+
+    unsigned char *raw = malloc(rawlen + 1);
+    unsigned char *comp = malloc(rawlen + rawlen / 255 + 16);
+    if (!raw || !comp) die("malloc");
+    size_t pos = 0;
+    for (j = from; j < to; j++) {
+        memcpy(raw + pos, E.row[j].chars, E.row[j].size);
+        pos += E.row[j].size;
+    }
+
+    size_t complen = lzCompress(raw, rawlen, comp);
+    int stored = complen >= rawlen; // compressing didn't help, keep the bytes as they are
+    if (stored) complen = rawlen;
+
+    coldBlock *blk = malloc(sizeof(coldBlock) + complen);
+    if (!blk) die("malloc");
+    blk->rawlen = rawlen;
+    blk->complen = complen;
+    blk->live = to - from;
+    memcpy(blk->data, stored ? raw : comp, complen);
+    free(comp);
+    free(raw);
+
+    pos = 0;
+    for (j = from; j < to; j++) {
+        erow *row = &E.row[j];
+        E.cold.resident -= editorRowCost(row);
+        if (row->render != row->chars) free(row->render);
+        if (row->pooled) slabRelease(&E.pool, row->chars);
+        else free(row->chars);
+
+        row->chars = NULL;
+        row->cold = blk;
+        row->rsize = pos;
+        row->pooled = 0;
+        row->packed = 1;
+        pos += row->size;
+    }
+    E.cold.rawbytes += rawlen;
+    E.cold.compbytes += complen;
+    return to - from;
+}
+
+// Gives a packed row its own chars and render again
+void editorRowUnpack(erow *row){
+    coldBlock *blk = row->cold;
+    editorColdLoad(blk);
+    E.cold.unpacked++;
+
+    char *chars = malloc(row->size + 1);
+    if (!chars) die("malloc");
+    memcpy(chars, E.cold.cache + row->rsize, row->size);
+    chars[row->size] = '\0';
+
+    row->chars = chars;
+    row->render = NULL;
+    row->packed = 0;
+    editorUpdateRow(row);
+    E.cold.resident += editorRowCost(row);
+    editorColdRelease(blk);
+}
+
+// Every access that needs a row's chars or render goes through here.
+// A packed row is unpacked on the spot, so the rest of the editor never sees one
+void editorRowTouch(erow *row){
+    if (row->packed) editorRowUnpack(row);
+    row->ref = 1;
+}
+
+// The row's chars, for reading only. A packed row stays packed, the pointer goes into
+// the block cache and is only good until the next call
+const char *editorRowChars(erow *row){
+    if (!row->packed) return row->chars;
+    editorColdLoad(row->cold);
+    return (const char *)E.cold.cache + row->rsize;
+}
+
+void editorUnpackRows(int from, int to){
+    int j;
+    for (j = from; j < to; j++) editorRowTouch(&E.row[j]);
+}
+
+// Whether the packer may take row j: not near the screen, and not used since it last came by
+int editorRowIsCold(int j){
+    return !E.row[j].packed && !E.row[j].ref &&
+           (j < E.rowoff - TEXIT_COLD_DISTANCE || j > E.rowoff + E.screenrows + TEXIT_COLD_DISTANCE);
+}
+
+// Moves the clock hand over the next rows while the rows take more memory than the budget.
+// Used rows get their ref bit cleared and a second chance, runs of cold rows get packed.
+// Returns 0 when there's nothing to do
+int editorColdStep(){
+    coldStore *c = &E.cold;
+    if (c->budget == 0 || c->resident <= c->budget || E.numrows == 0) return 0;
+    if (c->idle > 2 * E.numrows) return 0; // two rounds without finding anything cold
+
+    int scanned = 0;
+    while (scanned < TEXIT_COLD_SCAN && c->resident > c->budget) {
+        if (c->hand >= E.numrows) c->hand = 0;
+        int j = c->hand;
+
+        if (!editorRowIsCold(j)) {
+            if (!E.row[j].packed) E.row[j].ref = 0;
+            c->hand++;
+            c->idle++;
+            scanned++;
+            continue;
+        }
+
+        // take cold rows from here until the block is full
+        size_t raw = 0;
+        int end = j;
+        while (end < E.numrows && raw < TEXIT_COLD_BLOCK && editorRowIsCold(end))
+            raw += E.row[end++].size;
+        if (editorPackRows(j, end)) c->idle = 0;
+        else c->idle += end - j;
+        c->hand = end;
+        scanned += end - j;
+    }
+    return 1;
+}
+
+/*** Line commands ***/
+
+// Orders rows by their bytes, a shorter row goes first if it's a prefix of the other one
+int rowCompare(const erow *a, const erow *b){
+    int n = a->size < b->size ? a->size : b->size;
+    int c = memcmp(a->chars, b->chars, n);
+    if (c != 0) return c;
+    return (a->size > b->size) - (a->size < b->size);
+}
+
+// Merges the sorted runs src[lo, mid) and src[mid, hi) into dst[lo, hi).
+// On equal rows the left one goes first, which keeps the sort stable
+void mergeRows(erow **src, erow **dst, size_t lo, size_t mid, size_t hi){
+    size_t i = lo, j = mid, k = lo;
+    while (i < mid && j < hi)
+        dst[k++] = rowCompare(src[j], src[i]) < 0 ? src[j++] : src[i++];
+    while (i < mid) dst[k++] = src[i++];
+    while (j < hi) dst[k++] = src[j++];
+}
+
+// Sorts rows[lo, hi) with a bottom-up merge sort: insertion sort for runs of 32,
+// then the runs are merged in pairs, going back and forth between rows and tmp
+void mergeSortRows(erow **rows, erow **tmp, size_t lo, size_t hi){
+    size_t i, j;
+    for (i = lo; i < hi; i += 32) {
+        size_t end = i + 32 < hi ? i + 32 : hi;
+        for (j = i + 1; j < end; j++) {
+            erow *r = rows[j];
+            size_t k = j;
+            while (k > i && rowCompare(r, rows[k - 1]) < 0) {
+                rows[k] = rows[k - 1];
+                k--;
+            }
+            rows[k] = r;
+        }
+    }
+
+    erow **src = rows, **dst = tmp;
+    size_t width;
+    for (width = 32; width < hi - lo; width *= 2) {
+        for (i = lo; i < hi; i += 2 * width) {
+            size_t mid = i + width < hi ? i + width : hi;
+            size_t end = i + 2 * width < hi ? i + 2 * width : hi;
+            mergeRows(src, dst, i, mid, end);
+        }
+        erow **t = src; src = dst; dst = t;
+    }
+    if (src != rows) // the last pass left the result in tmp
+        memcpy(&rows[lo], &tmp[lo], sizeof(erow *) * (hi - lo));
+}
+
+void *sortWorker(void *arg){
+    sortJob *job = arg;
+    mergeSortRows(job->rows, job->tmp, job->lo, job->hi);
+    return NULL;
+}
+
+void *mergeWorker(void *arg){
+    sortJob *job = arg;
+    mergeRows(job->rows, job->tmp, job->lo, job->mid, job->hi);
+    memcpy(&job->rows[job->lo], &job->tmp[job->lo], sizeof(erow *) * (job->hi - job->lo));
+    return NULL;
+}
+
+// Sorts rows [from, to) of E.row. Only pointers to the rows are sorted, every thread
+// sorts a slice, then the slices are merged in pairs, also in parallel.
+// The resulting order is applied to E.row in one go at the end
+void editorSortRows(int from, int to){
+    size_t n = to - from;
+    if (n < 2) return;
+    editorUnpackRows(from, to); // the threads read the chars, so they all have to be there
+
+    erow **rows = malloc(sizeof(erow *) * n);
+    erow **tmp = malloc(sizeof(erow *) * n);
+    erow *sorted = malloc(sizeof(erow) * n);
+    if (!rows || !tmp || !sorted) die("malloc");
+
+    size_t i;
+    for (i = 0; i < n; i++) rows[i] = &E.row[from + i];
+
+    sortJob jobs[TEXIT_MAX_THREADS];
+    size_t bounds[TEXIT_MAX_THREADS + 1];
+    int nruns = editorThreadCount(n, TEXIT_LINES_MIN);
+    int j;
+    for (j = 0; j <= nruns; j++) bounds[j] = n * j / nruns;
+    for (j = 0; j < nruns; j++) {
+        jobs[j].rows = rows;
+        jobs[j].tmp = tmp;
+        jobs[j].lo = bounds[j];
+        jobs[j].hi = bounds[j + 1];
+    }
+    editorRunParallel(sortWorker, jobs, sizeof(sortJob), nruns);
+
+    // Every round merges neighbouring runs in pairs, halving the amount of runs
+    while (nruns > 1) {
+        int njobs = nruns / 2;
+        for (j = 0; j < njobs; j++) {
+            jobs[j].rows = rows;
+            jobs[j].tmp = tmp;
+            jobs[j].lo = bounds[2 * j];
+            jobs[j].mid = bounds[2 * j + 1];
+            jobs[j].hi = bounds[2 * j + 2];
+        }
+        editorRunParallel(mergeWorker, jobs, sizeof(sortJob), njobs);
+
+        // the runs are now the merged pairs, plus the odd one out if there was one
+        for (j = 0; j <= njobs; j++) bounds[j] = bounds[2 * j < nruns ? 2 * j : nruns];
+        bounds[njobs + (nruns % 2)] = n;
+        nruns = njobs + (nruns % 2);
+    }
+
+    for (i = 0; i < n; i++) sorted[i] = *rows[i];
+    memcpy(&E.row[from], sorted, sizeof(erow) * n);
+
+    free(sorted);
+    free(tmp);
+    free(rows);
+    E.dirty++;
+}
+
+void *filterWorker(void *arg){
+    filterJob *job = arg;
+    int i;
+    for (i = job->from; i < job->to; i++) {
+        erow *row = &E.row[i];
+        int keep;
+        if (job->mode == FILTER_UNIQ)
+            keep = i == job->first || rowCompare(row, &E.row[i - 1]) != 0;
+        else {
+            int found = memmem(row->chars, row->size, job->pattern, job->patlen) != NULL;
+            keep = job->mode == FILTER_KEEP ? found : !found;
+        }
+        job->keep[i - job->first] = keep;
+    }
+    return NULL;
+}
+
+// Drops rows from [from, to) of E.row. The rows are checked in parallel first,
+// then the kept ones are packed together and the rows after the range are moved once.
+// Returns the amount of rows removed
+int editorFilterRows(int from, int to, int mode, const char *pattern){
+    int n = to - from;
+    if (n < 1) return 0;
+    editorUnpackRows(from, to);
+
+    unsigned char *keep = malloc(n);
+    if (!keep) die("malloc");
+
+    filterJob jobs[TEXIT_MAX_THREADS];
+    int nthreads = editorThreadCount(n, TEXIT_LINES_MIN);
+    int j;
+    for (j = 0; j < nthreads; j++) {
+        jobs[j].from = from + (size_t)n * j / nthreads;
+        jobs[j].to = from + (size_t)n * (j + 1) / nthreads;
+        jobs[j].first = from;
+        jobs[j].mode = mode;
+        jobs[j].pattern = pattern;
+        jobs[j].patlen = pattern ? strlen(pattern) : 0;
+        jobs[j].keep = keep;
+    }
+    editorRunParallel(filterWorker, jobs, sizeof(filterJob), nthreads);
+
+    int at = from; // where the next kept row goes
+    for (j = 0; j < n; j++) {
+        if (keep[j]) E.row[at++] = E.row[from + j];
+        else editorFreeRow(&E.row[from + j]);
+    }
+    int removed = to - at;
+    memmove(&E.row[at], &E.row[to], sizeof(erow) * (E.numrows - to));
+    E.numrows -= removed;
+
+    free(keep);
+    if (removed) E.dirty++;
+    return removed;
+}
+
+// Ctrl-T: asks for a line command and runs it.
+// [FROM,TO] sort          sorts the lines
+// [FROM,TO] uniq          removes lines that are the same as the line above
+// [FROM,TO] keep TEXT     keeps only the lines containing TEXT
+// [FROM,TO] drop TEXT     removes the lines containing TEXT
+// Without FROM,TO (1-based, inclusive) the command works on the whole file
+void editorLineCommand(){
+    char *cmd = editorPrompt("Lines ([FROM,TO] sort|uniq|keep TEXT|drop TEXT): %s");
+    if (!cmd) return;
+
+    int from = 0, to = E.numrows;
+    char *p = cmd;
+    int a, b, used;
+    if (sscanf(p, "%d,%d %n", &a, &b, &used) == 2) {
+        if (a < 1) a = 1;
+        if (b > E.numrows) b = E.numrows;
+        from = a - 1;
+        to = b;
+        p += used;
+    }
+    if (from >= to) {
+        editorSetStatusMessage("Empty line range");
+        free(cmd);
+        return;
+    }
+
+    char *arg = strchr(p, ' ');
+    if (arg) *arg++ = '\0';
+
+    int removed = -1;
+    if (strcmp(p, "sort") == 0) {
+        editorSortRows(from, to);
+        editorSetStatusMessage("Sorted %d lines", to - from);
+    }
+    else if (strcmp(p, "uniq") == 0)
+        removed = editorFilterRows(from, to, FILTER_UNIQ, NULL);
+    else if ((strcmp(p, "keep") == 0 || strcmp(p, "drop") == 0) && arg && *arg)
+        removed = editorFilterRows(from, to, p[0] == 'k' ? FILTER_KEEP : FILTER_DROP, arg);
+    else {
+        editorSetStatusMessage("Unknown line command: %s", p);
+        free(cmd);
+        return;
+    }
+    if (removed >= 0) editorSetStatusMessage("Removed %d of %d lines", removed, to - from);
+
+    // rows moved all over the place, the word index is rebuilt from scratch
+    // and the packer looks at all of them again
+    wordIndexReset();
+    E.cold.idle = 0;
+    if (E.cy > E.numrows) E.cy = E.numrows;
+    E.cx = 0;
+    free(cmd);
+}
+
 /***  File I/O functions ***/
 
-char* editorRowsToString(int *buflen){
-    int totlen = 0; // total file string length
+// Serializes the rows starting from row `from` into one string, each row followed by '\n'
+char* editorRowsToString(int from, size_t *buflen){
+    size_t totlen = 0; // total string length
     int j;
-    for(j = 0; j < E.numrows; j++)
+    for(j = from; j < E.numrows; j++)
         totlen += E.row[j].size +1; // for each row +1 considering the addition of newline '\n'
-    *buflen = totlen; // total length of the file
+    *buflen = totlen; // total length of the string
 
-    char* buf = malloc(totlen); // allocate enough string space
+    char* buf = malloc(totlen ? totlen : 1); // allocate enough string space
+    if (!buf) die("malloc");
     char* p = buf;
     // Copies each row into the buffer, and adds the newline at the end
-    for(j = 0; j < E.numrows; j++){
-        memcpy(p, E.row[j].chars, E.row[j].size); 
+    for(j = from; j < E.numrows; j++){
+        memcpy(p, editorRowChars(&E.row[j]), E.row[j].size); // packed rows can stay packed
         p += E.row[j].size;
         *p = '\n';
         p++; // after adding '\n' go to next line
@@ -429,57 +2115,182 @@ char* editorRowsToString(int *buflen){
     return buf;
 }
 
+// Finds the first row that isn't already on disk exactly where a full save would put it.
+// Everything before it can stay as it is. *pos is set to the file offset of that row
+int editorFirstChangedRow(off_t *pos){
+    off_t at = 0;
+    int j;
+    for (j = 0; j < E.numrows; j++) {
+        // rows that were edited, inserted, or moved because of rows above them
+        if (E.row[j].changed || E.row[j].off != at) break;
+        at += E.row[j].size + 1;
+    }
+    *pos = at;
+    return j;
+}
+
+// Reads everything from fd into a malloc'd buffer.
+// Only used for files we can't mmap, like pipes
+char* editorReadAll(int fd, size_t *len){
+    size_t cap = 1 << 16;
+    char *buf = malloc(cap);
+    if (!buf) die("malloc");
+    *len = 0;
+    ssize_t n;
+    while ((n = read(fd, buf + *len, cap - *len)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            die("read");
+        }
+        *len += n;
+        if (*len == cap) { // buffer full --> double it
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (!buf) die("realloc");
+        }
+    }
+    return buf;
+}
+
+// Guesses whether the data is binary from its beginning:
+// any NUL byte, or more than 1 in 10 control characters that text files don't use
+int editorIsBinary(const char *buf, size_t len){
+    size_t n = len < TEXIT_BINARY_SNIFF ? len : TEXIT_BINARY_SNIFF;
+    size_t ctrl = 0, i;
+    for (i = 0; i < n; i++) {
+        unsigned char c = buf[i];
+        if (c == '\0') return 1;
+        if (c < 32 && !strchr("\t\n\r\f\v\b\x1b", c)) ctrl++;
+    }
+    return ctrl * 10 > n;
+}
+
+// Remembers which file, and which version of it, the rows now match
+void editorStampFile(const struct stat *st){
+    E.filesize = S_ISREG(st->st_mode) ? st->st_size : -1;
+    E.filemtime = st->st_mtim;
+    E.filedev = st->st_dev;
+    E.fileino = st->st_ino;
+}
+
+// Whether the file is still exactly the one editorStampFile() saw last
+int editorFileUnchanged(const struct stat *st){
+    return st->st_size == E.filesize
+        && st->st_dev == E.filedev && st->st_ino == E.fileino
+        && st->st_mtim.tv_sec == E.filemtime.tv_sec
+        && st->st_mtim.tv_nsec == E.filemtime.tv_nsec;
+}
 
 void editorOpen(char* filename){
     free(E.filename);
     E.filename = strdup(filename);
 
     // open the given file
-    FILE* fp = fopen(filename, "r");
-    if (!fp) die("fopen");
-
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    // while loop through each row in the FILE.
-    while((linelen = getline(&line, &linecap, fp)) != -1){ // not errored
-        while (linelen > 0 && (line[linelen-1] == '\n' ||
-                              line[linelen-1] == '\r'))
-        linelen--; // decrease the row's length to not use '\n' & '\r' which are the end
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) die("fstat");
+
+    // Regular files are mapped straight into memory, so no time is spent
+    // copying them through stdio buffers before we even look for the newlines
+    editorStampFile(&st);
+    if (S_ISREG(st.st_mode)) {
+        size_t len = st.st_size;
+        if (len > 0) { // mmap refuses to map 0 bytes
+            // Read-only, as a writable private mapping would be charged in full up front
+            // and fail for files bigger than memory. The hex view unprotects the pages it edits
+            char *buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (buf == MAP_FAILED) die("mmap");
+
+            if (editorIsBinary(buf, len)) { // binary files stay mapped for the hex view
+                E.hex.active = 1;
+                E.hex.map = (unsigned char *)buf;
+                E.hex.size = len;
+                E.hex.offwidth = 8;
+                while (E.hex.offwidth < 16 && (len - 1) >> (4 * E.hex.offwidth)) E.hex.offwidth++;
+                close(fd);
+                E.dirty = 0;
+                return;
+            }
 
-        // line - our char row from the file | linelen - length of line row
-        editorAppendRow(line, linelen);
+            madvise(buf, len, MADV_SEQUENTIAL); // just a hint, errors don't matter
+            editorLoadBuffer(buf, len);
+            munmap(buf, len);
+        }
+    }
+    else {
+        size_t len;
+        char *buf = editorReadAll(fd, &len);
+        editorLoadBuffer(buf, len);
+        free(buf);
     }
 
-    free(line);
-    fclose(fp);
+    close(fd);
 
     E.dirty = 0;
 }
 
+// Only the part of the file from the first changed row onwards is written.
+// If the file on disk isn't the one we loaded/saved last, the whole file is rewritten
 void editorSave(){
     if (E.filename == NULL) return; // If no file was opened
-
-    int len;
-    char *buf = editorRowsToString(&len); // get the string with full file contents
+    if (E.hex.active) {
+        editorHexSave();
+        return;
+    }
 
     // open the file
     int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
     // error checking
     if(fd != -1){
-        // truncate the file by increasing or decreasing depending on the length len
-        if(ftruncate(fd, len) != -1){ // if truncating was successful
-            if(write(fd, buf, len) == len){ // if write successful
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+        off_t pos;
+        int from = editorFirstChangedRow(&pos);
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || !editorFileUnchanged(&st)) { // someone else changed or replaced the file
+            from = 0;
+            pos = 0;
+        }
+
+        size_t len;
+        char *buf = editorRowsToString(from, &len); // get the string with the changed file contents
+
+        // write everything, one call may not write it all for big buffers
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pwrite(fd, buf + done, len - done, pos + done);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                break;
             }
+            done += n;
         }
+
+        // cut off whatever is left of the old file after the new end
+        if(done == len && ftruncate(fd, pos + len) != -1){ // if writing and truncating was successful
+            // our own write moved the mtime, remember the new one
+            if (fstat(fd, &st) == -1) E.filesize = -1; // can't tell, the next save writes everything
+            else editorStampFile(&st);
+            close(fd);
+            free(buf);
+
+            // the rows we wrote are now exactly where they are on disk
+            int j;
+            off_t at = pos;
+            for (j = from; j < E.numrows; j++) {
+                E.row[j].off = at;
+                E.row[j].changed = 0;
+                at += E.row[j].size + 1;
+            }
+
+            E.dirty = 0;
+            editorSetStatusMessage("%zu bytes written to disk", len);
+            return;
+        }
+        free(buf);
         close(fd);
     }
-    free(buf);
     editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
@@ -511,11 +2322,191 @@ void abFree(struct abuf *ab) {
     return;
 }
 
+/*** Hex view ***/
+
+// Turns n bytes into 2n hex digits
+void hexEncode(const unsigned char *in, size_t n, char *out){
+    static const char digits[] = "0123456789abcdef";
+    size_t i = 0;
+#ifdef __SSE2__
+    // 16 bytes at a time: split every byte into its two nibbles, interleave them
+    // high first, then turn 0-9 into '0'-'9' and 10-15 into 'a'-'f'
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10); // distance between '9'+1 and 'a'
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low4);
+        __m128i lo = _mm_and_si128(v, low4);
+        __m128i a = _mm_unpacklo_epi8(hi, lo); // digits of bytes 0-7
+        __m128i b = _mm_unpackhi_epi8(hi, lo); // digits of bytes 8-15
+        a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+        b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), a);
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), b);
+    }
+#endif
+    for (; i < n; i++) {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 0x0f];
+    }
+}
+
+// Amount of hex rows, the last one can be shorter than TEXIT_HEX_WIDTH
+int editorHexRows(){
+    return (E.hex.size + TEXIT_HEX_WIDTH - 1) / TEXIT_HEX_WIDTH;
+}
+
+// Screen column of the cursor: the offset and 2 blanks, then 3 chars per byte
+int editorHexCxToRx(){
+    return E.hex.offwidth + 2 + E.cx * 3 + E.hex.nibble;
+}
+
+// Formats hex row r into line: offset, hex bytes and their printable characters.
+// Returns the length of the line
+int editorHexFormatRow(int r, char *line){
+    size_t off = (size_t)r * TEXIT_HEX_WIDTH;
+    size_t n = E.hex.size - off < TEXIT_HEX_WIDTH ? E.hex.size - off : TEXIT_HEX_WIDTH;
+    char hex[2 * TEXIT_HEX_WIDTH];
+    hexEncode(E.hex.map + off, n, hex);
+
+    int len = snprintf(line, E.hex.offwidth + 3, "%0*zx  ", E.hex.offwidth, off);
+    size_t i;
+    for (i = 0; i < TEXIT_HEX_WIDTH; i++) { // "hh " per byte, blanks after the end of the file
+        line[len++] = i < n ? hex[2 * i] : ' ';
+        line[len++] = i < n ? hex[2 * i + 1] : ' ';
+        line[len++] = ' ';
+    }
+    line[len++] = ' ';
+    line[len++] = '|';
+    for (i = 0; i < n; i++) { // non-printable bytes would mess up the terminal, so they're dots
+        unsigned char c = E.hex.map[off + i];
+        line[len++] = c >= 32 && c < 127 ? c : '.';
+    }
+    line[len++] = '|';
+    return len;
+}
+
+// Draws only the hex rows that are on the screen
+void editorDrawHexRows(struct abuf *ab){
+    char line[16 + 2 + 4 * TEXIT_HEX_WIDTH + 3]; // widest offset, blanks, bytes, " ||"
+    int y;
+    for (y = 0; y < E.screenrows; y++) {
+        int r = y + E.rowoff;
+        if (r >= editorHexRows()) abAppend(ab, "~", 1);
+        else {
+            int len = editorHexFormatRow(r, line) - E.coloff;
+            if (len < 0) len = 0;
+            if (len > E.screencols) len = E.screencols;
+            abAppend(ab, &line[E.coloff], len);
+        }
+        abAppend(ab, "\x1b[K", 3);
+        abAppend(ab, "\r\n", 2);
+    }
+}
+
+// Moves the cursor to byte `pos` of the file, on its high digit
+void editorHexGoto(size_t pos){
+    if (pos >= E.hex.size) pos = E.hex.size - 1;
+    E.cy = pos / TEXIT_HEX_WIDTH;
+    E.cx = pos % TEXIT_HEX_WIDTH;
+    E.hex.nibble = 0;
+}
+
+// Key handling of the hex view. Hex digits overwrite the digit under the cursor,
+// there is no inserting or deleting, the file keeps its size
+void editorHexProcessKey(int c){
+    size_t pos = (size_t)E.cy * TEXIT_HEX_WIDTH + E.cx;
+    size_t page = (size_t)E.screenrows * TEXIT_HEX_WIDTH;
+
+    switch (c) {
+        case ARROW_LEFT:
+        case BACKSPACE:
+        case CTRL_KEY('h'):
+            if (E.hex.nibble) E.hex.nibble = 0;
+            else if (pos > 0) editorHexGoto(pos - 1);
+            break;
+        case ARROW_RIGHT:
+            editorHexGoto(pos + 1);
+            break;
+        case ARROW_UP:
+            if (pos >= TEXIT_HEX_WIDTH) editorHexGoto(pos - TEXIT_HEX_WIDTH);
+            break;
+        case ARROW_DOWN:
+            if (pos + TEXIT_HEX_WIDTH < E.hex.size) editorHexGoto(pos + TEXIT_HEX_WIDTH);
+            break;
+        case PAGE_UP:
+            editorHexGoto(pos >= page ? pos - page : pos % TEXIT_HEX_WIDTH);
+            break;
+        case PAGE_DOWN:
+            editorHexGoto(pos + page);
+            break;
+        case HOME_KEY:
+            editorHexGoto(pos - E.cx);
+            break;
+        case END_KEY:
+            editorHexGoto(pos - E.cx + TEXIT_HEX_WIDTH - 1);
+            break;
+
+        default:
+            if (c < 128 && isxdigit(c)) {
+                int d = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+                // only this page gets a private copy, the rest of the map stays read-only
+                size_t pagesize = sysconf(_SC_PAGESIZE);
+                if (mprotect(E.hex.map + pos / pagesize * pagesize, pagesize, PROT_READ | PROT_WRITE) == -1) {
+                    editorSetStatusMessage("Can't edit: %s", strerror(errno));
+                    break;
+                }
+                unsigned char *b = &E.hex.map[pos];
+                if (E.hex.nibble == 0) *b = (*b & 0x0f) | (d << 4);
+                else *b = (*b & 0xf0) | d;
+
+                // grow the range that the next save has to write
+                if (E.hex.dirtyhi == 0 || pos < E.hex.dirtylo) E.hex.dirtylo = pos;
+                if (pos + 1 > E.hex.dirtyhi) E.hex.dirtyhi = pos + 1;
+                E.dirty++;
+
+                if (E.hex.nibble == 0) E.hex.nibble = 1;
+                else if (pos + 1 < E.hex.size) editorHexGoto(pos + 1);
+            }
+            break;
+    }
+}
+
+// Writes back only the overwritten bytes, the size of the file never changes
+void editorHexSave(){
+    size_t lo = E.hex.dirtylo, len = E.hex.dirtyhi - E.hex.dirtylo;
+    int fd = open(E.filename, O_WRONLY);
+    if (fd != -1) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pwrite(fd, E.hex.map + lo + done, len - done, lo + done);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            done += n;
+        }
+        close(fd);
+        if (done == len) {
+            E.hex.dirtylo = E.hex.dirtyhi = 0;
+            E.dirty = 0;
+            editorSetStatusMessage("%zu bytes written to disk", len);
+            return;
+        }
+    }
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
 /*** Functions for terminal output ***/
 
 void editorScroll(){
     E.rx = 0;
-    if (E.cy < E.numrows) {
+    if (E.hex.active) {
+        E.rx = editorHexCxToRx();
+    }
+    else if (E.cy < E.numrows) {
         E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
     }
 
@@ -535,6 +2526,11 @@ void editorScroll(){
 
 
 void editorDrawRows(struct abuf *ab) {
+    if (E.hex.active) {
+        editorDrawHexRows(ab);
+        return;
+    }
+
     int y;
     for (y = 0; y < E.screenrows; y++) {
         int filerow = y + E.rowoff; //
@@ -564,6 +2560,7 @@ void editorDrawRows(struct abuf *ab) {
             }
         }
         else{ // If we have a file with contents, then print those
+            editorRowTouch(&E.row[filerow]);
             // We subtract so that we don't cut the row contents halfway
             int len = E.row[filerow].rsize - E.coloff;
             if(len < 0) len = 0; // If we scroll past the row's content/chars
@@ -589,12 +2586,27 @@ void editorDrawStatusBar(struct abuf *ab){
 
     // the string length of status (strlen) after writing the message into the buffer
     // Copies the filename and amount of lines in the file. IF no file --> [No Name] & 0 lines
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-        E.filename ? E.filename : "[No Name]", E.numrows,
-        E.dirty ? "(modified)" : ""); // If dirty = 1 --> display "(modified)"
-    // Copies on which line out of all the lines our cursor currently lies on
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-        E.cy + 1, E.numrows);
+    int len, rlen;
+    if (E.hex.active) { // binary file: size in bytes, and the cursor's byte offset
+        len = snprintf(status, sizeof(status), "%.20s - %zu bytes [hex] %s",
+            E.filename, E.hex.size, E.dirty ? "(modified)" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "0x%zx/0x%zx",
+            (size_t)E.cy * TEXIT_HEX_WIDTH + E.cx, E.hex.size);
+    }
+    else {
+        len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+            E.filename ? E.filename : "[No Name]", E.numrows,
+            E.dirty ? "(modified)" : ""); // If dirty = 1 --> display "(modified)"
+        // Copies on which line out of all the lines our cursor currently lies on
+        rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
+            E.cy + 1, E.numrows);
+        if (E.cold.budget) { // compression ratio, how often the block cache saved a decompression
+            unsigned long total = E.cold.hits + E.cold.misses; // and how many rows came back
+            rlen += snprintf(&rstatus[rlen], sizeof(rstatus) - rlen, " | lz %.1fx %.1f%% hit %lu back",
+                E.cold.compbytes ? (double)E.cold.rawbytes / E.cold.compbytes : 1.0,
+                total ? 100.0 * E.cold.hits / total : 100.0, E.cold.unpacked);
+        }
+    }
 
     if (len > E.screencols) len = E.screencols; // in case length is longer than colnum
     abAppend(ab, status, len);
@@ -673,6 +2685,70 @@ void editorSetStatusMessage(const char *fmt, ...){
 
 /*** Functions to process input  ***/
 
+// Shows prompt in the status bar and lets the user type an answer.
+// prompt has a %s where the answer goes. Returns the malloc'd answer, or NULL on ESC
+char *editorPrompt(char *prompt){
+    size_t bufsize = 128;
+    char *buf = malloc(bufsize);
+    if (!buf) die("malloc");
+    size_t buflen = 0;
+    buf[0] = '\0';
+
+    while (1) {
+        editorSetStatusMessage(prompt, buf);
+        editorRefreshScreen();
+
+        int c = editorReadKey();
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+            if (buflen != 0) buf[--buflen] = '\0';
+        }
+        else if (c == '\x1b') { // cancelled
+            editorSetStatusMessage("");
+            free(buf);
+            return NULL;
+        }
+        else if (c == '\r') {
+            if (buflen != 0) {
+                editorSetStatusMessage("");
+                return buf;
+            }
+        }
+        else if (!iscntrl(c) && c < 128) {
+            if (buflen == bufsize - 1) { // full --> double the buffer
+                bufsize *= 2;
+                buf = realloc(buf, bufsize);
+                if (!buf) die("realloc");
+            }
+            buf[buflen++] = c;
+            buf[buflen] = '\0';
+        }
+    }
+}
+
+// Checks whether a key press is waiting to be read, without blocking
+int editorInputPending(){
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Background work, done between key presses. It stops as soon as a key comes in,
+// so typing never has to wait for it
+void editorIdle(){
+    // The packer gives up after going around without finding anything cold.
+    // Scrolling (or a new budget) can make rows cold, so then it gets to look again
+    coldStore *c = &E.cold;
+    if (c->rowoff != E.rowoff || c->seenbudget != c->budget) {
+        c->rowoff = E.rowoff;
+        c->seenbudget = c->budget;
+        c->idle = 0;
+    }
+    while (!editorInputPending()) {
+        int more = wordIndexStep();
+        more |= editorColdStep();
+        if (!more) break;
+    }
+}
+
 // Function responsible for the primitives up, down, left, right moves
 void editorMoveCursor(int key) {
     erow* row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
@@ -724,11 +2800,18 @@ void editorProcessKeypress(){
     static int quit_times = KILO_QUIT_TIMES;
 
     int c = editorReadKey(); // returns the key that was read
+
+    // Binary files only know how to save and quit, everything else is handled by the hex view
+    if (E.hex.active && c != CTRL_KEY('q') && c != CTRL_KEY('s')) {
+        editorHexProcessKey(c);
+        quit_times = KILO_QUIT_TIMES;
+        return;
+    }
     // arrow keys
 
     switch (c) {
         case '\r': // Enter key
-            /* TODO*/
+            editorInsertNewline();
             break;
 
         case CTRL_KEY('q'): // Press CTRL+Q 3 times in a row to exit
@@ -746,6 +2829,18 @@ void editorProcessKeypress(){
             editorSave();
             break;
 
+        case CTRL_KEY('n'):
+            editorCompleteWord();
+            break;
+
+        case CTRL_KEY('w'):
+            editorJumpToWord();
+            break;
+
+        case CTRL_KEY('t'):
+            editorLineCommand();
+            break;
+
         case HOME_KEY:
             E.cx = 0;
             break;
@@ -816,9 +2911,22 @@ void initEditor() {
     E.rowoff = 0;
     E.coloff = 0;
     E.numrows = 0;
+    E.rowcap = 0;
     E.row = NULL;
+    slabArena pool = SLAB_ARENA_INIT;
+    E.pool = pool;
+    wordIndex words = { NULL, 0, 0, SLAB_ARENA_INIT, NULL, 0, 0, 0, NULL, 0, 0 };
+    E.words = words;
+    hexView hex = { 0, NULL, 0, 8, 0, 0, 0 };
+    E.hex = hex;
+    coldStore cold = { 0, 0, 0, 0, 0, 0, 0, NULL, NULL, 0, 0, 0, 0, 0 };
+    E.cold = cold;
+    // Optional memory budget for the rows, in megabytes
+    char *budget = getenv("TEXIT_MEMORY_BUDGET");
+    if (budget) E.cold.budget = strtoull(budget, NULL, 10) << 20;
     E.dirty = 0;
     E.filename = NULL;
+    E.filesize = -1;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
 
@@ -836,10 +2944,14 @@ int main(int argc, char *argv[]){
         editorOpen(argv[1]);
     }
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit");
+    if (E.hex.active)
+        editorSetStatusMessage("HELP: 0-9 a-f = overwrite | Ctrl-S = save | Ctrl-Q = quit");
+    else
+        editorSetStatusMessage("HELP: ^S save | ^Q quit | ^N complete | ^W next word | ^T line command");
 
     while (1) {
         editorRefreshScreen();
+        editorIdle();
         editorProcessKeypress();
     }
 